@@ -16,38 +16,80 @@
 #include "spacetime.h"
 #include "shaders.h"
 #include "helper_methods.h"
+#include "options.h"
+#include "offscreen.h"
+#include "scheduler.h"
+#include "predictor.h"
+#include "telemetry.h"
 
-int main()
+int main(int argc, char** argv)
 {
     std::cout << "Beginning an OpenGL project that simulates gravity." << std::endl;
 
+    RunOptions options;
+    if (!parseOptions(argc, argv, options)) return -1;
+
+    // fork the force workers before any window or GL state exists
+    DomainDecomposition* domains = nullptr;
+    if (options.workers > 0)
+    {
+        domains = new DomainDecomposition(options.workers, maxSharedBodies);
+        domains->setOpeningAngle(options.theta);
+    }
+
+#ifdef GLFW_PLATFORM_NULL
+    // osmesa needs no display server at all, so skip X11/Wayland entirely (glfw 3.4+)
+    if (options.offscreen && options.context == "osmesa")
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+
     // init GLFW
-    glfwInit();
+    if (!glfwInit())
+    {
+        std::cerr << "Failed to initialize GLFW" << std::endl;
+        delete domains;
+        return -1;
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     // glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
+    if (options.offscreen)
+    {
+        // the window only carries the context, everything is drawn into an FBO
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        if (options.context == "egl")
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        else if (options.context == "osmesa")
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+    }
+
     // create a window
     GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Gravity Simulation", NULL, NULL);
     if (window==NULL) // returns null if doesn't work
     {
         std::cerr << "Failed to create GLFW window" << std::endl;
+        delete domains;
         glfwTerminate(); // end of glfwInit()
         return -1;
     }
 
     // callbacks
     glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback); // create a callback for window resizing!
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (!options.offscreen)
+    {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback); // create a callback for window resizing!
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     // initialize GLAD?
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) 
     {
         std::cerr << "Failed to initialize GLAD" << std::endl;
+        delete domains;
         return -1;
     }
 
@@ -157,6 +199,7 @@ int main()
     } 
 
     System system(planetPtrs);
+    system.domains = domains;
 
     // initialize spacetime grid
     std::vector<float> gridVertices = generateGridVertices();
@@ -194,25 +237,98 @@ int main()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
+    // orbit preview lines, refilled only when the predictor publishes new paths
+    GLuint orbitVAO, orbitVBO;
+    glGenVertexArrays(1, &orbitVAO);
+    glBindVertexArray(orbitVAO);
+    glGenBuffers(1, &orbitVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    // predict the cyan planet's orbit around the yellow star
+    TrajectoryPredictor* predictor = nullptr;
+    if (options.predictHorizon > 0.0f)
+        predictor = new TrajectoryPredictor({1}, options.predictHorizon);
+    long long orbitGeneration = 0;
+    std::vector<GLint> orbitFirst, orbitCount;
+
+    // headless runs step at a fixed rate and capture on a fixed simulation-time cadence
+    FrameRecorder* recorder = nullptr;
+    if (options.offscreen)
+    {
+        recorder = new FrameRecorder(SCREEN_WIDTH, SCREEN_HEIGHT, options.fps, options.outputDir, options.format);
+        std::cout << "Rendering offscreen to " << options.outputDir << " (" << options.format << ")" << std::endl;
+    }
+    // double so a long run's time and capture cadence don't drift from float rounding
+    double simTime = 0.0;
+    double nextCapture = 0.0;
+    float deltaTime = 0.0f;
+    long long frame = 0;
+    double initialEnergy = system.snapshot(simTime).totalEnergy();
+    Metric* energyDriftMetric = nullptr; // set up with the other telemetry below
+    glm::mat4 view;
+
     float lastTime = glfwGetTime();
 
     glUseProgram(shaderProgram);
     glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // GLFW WINDOW LOOP
-    while(!glfwWindowShouldClose(window))
+    // draw renders `front` while fill writes the step being computed into `back`
+    FrameSnapshot front{{}, simTime}, back{{}, simTime};
+    fillSnapshots(planets, front.planets);
+
+    // frame pipeline: input -> force -> integrate -> fill computes the next step on
+    // workers while draw renders the previous one on the main thread.
+    // diagnostics and checkpoints only copy the state inside the frame and do the
+    // slow part on the background queue, which no frame waits for
+    TaskGraph graph;
+    BackgroundQueue background;
+
+    int inputStage = graph.add("input", Executor::Main, {}, [&]() -> StageTask
     {
         float currentTime = glfwGetTime();
-        float deltaTime = currentTime - lastTime;
+        deltaTime = currentTime - lastTime;
         lastTime = currentTime;
+        if (recorder) deltaTime = options.timeStep;
+        simTime += deltaTime;
+
+        // process all key inputs
+        if (!recorder) processInput(window, deltaTime);
+
+        view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        co_return;
+    });
+
+    int forceStage = graph.add("force", Executor::Worker, {inputStage}, [&]() -> StageTask
+    {
+        system.computeForces();
+        co_return;
+    });
+
+    int integrateStage = graph.add("integrate", Executor::Worker, {forceStage}, [&]() -> StageTask
+    {
+        system.integrate(deltaTime);
+        co_return;
+    });
+
+    graph.add("fill", Executor::Worker, {integrateStage}, [&]() -> StageTask
+    {
+        fillSnapshots(planets, back.planets);
+        back.simTime = simTime;
+        co_return;
+    });
+
+    graph.add("draw", Executor::Main, {inputStage}, [&]() -> StageTask
+    {
+        // offscreen, a frame that won't be captured is never seen, so don't render it
+        if (recorder && front.simTime < nextCapture) co_return;
+        if (recorder) recorder->bind();
 
         // clear colors from each pixel every frame
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // bitwise or operator takes bit masks as args
 
-        // process all key inputs
-        processInput(window, deltaTime);
-
-        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
         glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
         // render + draw
@@ -226,6 +342,39 @@ int main()
         glBindVertexArray(gridVAO);
         glDrawArrays(GL_LINES, 0, gridVertices.size() / 3);
         glBindVertexArray(0);
+
+        // draw predicted orbits with the grid shader, in each body's color
+        if (predictor)
+        {
+            std::shared_ptr<const PredictedPaths> paths = predictor->latest();
+            glBindVertexArray(orbitVAO);
+            if (paths && paths->generation != orbitGeneration)
+            {
+                orbitGeneration = paths->generation;
+                orbitFirst.clear();
+                orbitCount.clear();
+                size_t total = 0;
+                for (const std::vector<float>& line : paths->lines) total += line.size();
+
+                glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+                glBufferData(GL_ARRAY_BUFFER, total * sizeof(float), NULL, GL_STREAM_DRAW);
+                size_t offset = 0;
+                for (const std::vector<float>& line : paths->lines)
+                {
+                    glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(float), line.size() * sizeof(float), line.data());
+                    orbitFirst.push_back(static_cast<GLint>(offset / 3));
+                    orbitCount.push_back(static_cast<GLint>(line.size() / 3));
+                    offset += line.size();
+                }
+            }
+            for (int k = 0; k < orbitFirst.size(); k++)
+            {
+                const Color& color = front.planets[predictor->selection()[k]].centerColor;
+                glUniform3f(glGetUniformLocation(gridShaderProgram, "uColor"), color.R, color.G, color.B);
+                glDrawArrays(GL_LINE_STRIP, orbitFirst[k], orbitCount[k]);
+            }
+            glBindVertexArray(0);
+        }
         
 
         // draw planets
@@ -235,42 +384,169 @@ int main()
         glUseProgram(shaderProgram);
         glBindVertexArray(VAO);
 
-        // update full system here
-        system.computeSystemProperties();
-
-        for (Body &planet : planets)
+        for (int i = 0; i < front.planets.size(); i++)
         {
-            // update objects
-            // planet.collisionCheck(aspectRatio);
-            planet.accelerate(deltaTime);
-            planet.updatePosition(deltaTime);
+            const PlanetSnapshot& planet = front.planets[i];
 
             // update vertex buffer for this planet
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
             glBufferSubData(GL_ARRAY_BUFFER, 0, planet.vertices.size() * sizeof(float), planet.vertices.data());
 
-            // update element buffer too
+            // update element buffer too (indices never change, safe to read while the step runs)
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, planet.indices.size() * sizeof(unsigned int), planet.indices.data());
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, planets[i].indices.size() * sizeof(unsigned int), planets[i].indices.data());
             
             glm::mat4 model = glm::mat4(1.0f);
             // model = glm::translate(model, glm::vec3(planet.position.x, planet.position.y, planet.position.z));
             // model = glm::scale(model, glm::vec3(planet.radius));
             glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-            glUniform2f(planetCenterLocation, planet.GetPosition().x, planet.GetPosition().y);
-            glUniform1f(planetRadiusLocation, planet.GetRadius());
+            glUniform2f(planetCenterLocation, planet.position.x, planet.position.y);
+            glUniform1f(planetRadiusLocation, planet.radius);
             glUniform3f(centerColorLocation, planet.centerColor.R, planet.centerColor.G, planet.centerColor.B);
             glUniform3f(edgeColorLocation, planet.edgeColor.R, planet.edgeColor.G, planet.edgeColor.B);
             
             // glDrawArrays(GL_TRIANGLE_FAN, 0, planet.vertices.size() / 3); // 2D circle
-            glDrawElements(GL_TRIANGLES, planet.indices.size(), GL_UNSIGNED_INT, 0); // 3D sphere
+            glDrawElements(GL_TRIANGLES, planets[i].indices.size(), GL_UNSIGNED_INT, 0); // 3D sphere
+        }
+        co_return;
+    });
+
+    graph.add("predict", Executor::Worker, {integrateStage}, [&]() -> StageTask
+    {
+        // cheap unless the bodies left the cached prediction, the integration is on the predictor's thread
+        if (predictor) predictor->observe(planets, static_cast<float>(simTime));
+        co_return;
+    });
+
+    graph.add("snapshot", Executor::Worker, {integrateStage}, [&]() -> StageTask
+    {
+        // energy is a full pair sweep, so telemetry samples it every 60 frames unless asked otherwise
+        int every = options.diagnostics > 0 ? options.diagnostics : 60;
+        bool diagnose = (options.diagnostics > 0 || energyDriftMetric) && frame % every == 0;
+        bool checkpoint = !options.checkpoint.empty() && frame % options.checkpointEvery == 0;
+        if (!diagnose && !checkpoint) co_return;
+
+        std::shared_ptr<const SystemSnapshot> state = std::make_shared<const SystemSnapshot>(system.snapshot(simTime));
+        if (diagnose)
+        {
+            // a busy queue just skips this sample
+            background.post([state, &options, initialEnergy, energyDriftMetric]()
+            {
+                double energy = state->totalEnergy();
+                double drift = (energy - initialEnergy) / std::fabs(initialEnergy);
+                if (energyDriftMetric) energyDriftMetric->set(drift);
+                if (options.diagnostics > 0)
+                {
+                    std::cout << "t=" << state->time << " energy=" << energy
+                              << " drift=" << drift
+                              << " pairs=" << state->pairs << std::endl;
+                }
+            });
+        }
+        if (checkpoint)
+        {
+            bool queued = background.post([state, &options]()
+            {
+                if (!state->saveCheckpoint(options.checkpoint))
+                    std::cerr << "Failed to write checkpoint " << options.checkpoint << std::endl;
+            });
+            if (!queued) std::cerr << "Skipped checkpoint at t=" << state->time << ", earlier ones are still being written" << std::endl;
+        }
+        co_return;
+    });
+
+    // metrics for --telemetry, all registered before the publisher starts
+    Telemetry* telemetry = nullptr;
+    Metric* simTimeMetric = nullptr;
+    Metric* bodiesMetric = nullptr;
+    Metric* pairsMetric = nullptr;
+    Metric* frameMetric = nullptr;
+    std::vector<Metric*> phaseMetrics;
+    if (!options.telemetry.empty())
+    {
+        telemetry = new Telemetry();
+        simTimeMetric = telemetry->add("gravity_sim_time", "", "Simulation time reached.", "gauge");
+        bodiesMetric = telemetry->add("gravity_bodies", "", "Bodies in the system.", "gauge");
+        pairsMetric = telemetry->add("gravity_regularized_pairs", "", "Close pairs advanced in KS coordinates.", "gauge");
+        energyDriftMetric = telemetry->add("gravity_energy_drift", "", "Relative change of total energy since start.", "gauge");
+        frameMetric = telemetry->add("gravity_frame_seconds", "", "Wall time of the last frame graph run.", "gauge");
+        for (int i = 0; i < graph.stageCount(); i++)
+        {
+            phaseMetrics.push_back(telemetry->add("gravity_phase_seconds", "phase=\"" + graph.stageName(i) + "\"",
+                                                  "Wall time of each frame stage in the last frame.", "gauge"));
+        }
+        if (!telemetry->start(options.telemetry))
+        {
+            // nothing may keep pointing into the metrics that go away with it
+            delete telemetry;
+            telemetry = nullptr;
+            simTimeMetric = bodiesMetric = pairsMetric = energyDriftMetric = frameMetric = nullptr;
+            phaseMetrics.clear();
+        }
+    }
+
+    // ctrl+c or kill ends the loop instead of the process
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    // GLFW WINDOW LOOP
+    while(!glfwWindowShouldClose(window) && !stopRequested)
+    {
+        graph.run();
+        double drawnTime = front.simTime; // the framebuffer now holds this step, not simTime
+        std::swap(front, back);
+
+        if (telemetry)
+        {
+            // relaxed stores only, the publisher thread reads them whenever it is scraped
+            telemetry->stepCounter()->add(1.0);
+            telemetry->interactionCounter()->add(static_cast<double>(system.interactions));
+            simTimeMetric->set(simTime);
+            bodiesMetric->set(planets.size());
+            pairsMetric->set(system.encounters.pairs.size());
+            frameMetric->set(graph.runMilliseconds() / 1000.0);
+            for (int i = 0; i < phaseMetrics.size(); i++)
+                phaseMetrics[i]->set(graph.stageMilliseconds(i) / 1000.0);
         }
 
-        glfwSwapBuffers(window); // double buffer rendering
+        if (options.graphDump > 0 && frame % options.graphDump == 0) graph.dump(std::cout);
+        frame++;
+
+        if (recorder)
+        {
+            // only frames on the capture cadence are drawn and read back, the rest just advance the simulation
+            if (drawnTime >= nextCapture)
+            {
+                recorder->capture();
+                // the first slot after drawnTime, so a step longer than the interval doesn't leave it behind
+                nextCapture = (std::floor(drawnTime / options.frameInterval) + 1.0) * options.frameInterval;
+                if (options.frames > 0 && recorder->captured() >= options.frames)
+                    glfwSetWindowShouldClose(window, GL_TRUE);
+            }
+        }
+        else
+        {
+            glfwSwapBuffers(window); // double buffer rendering
+        }
         glfwPollEvents();        // checks for any event triggering, updates window state and calls the right functions
     }
 
+    background.finish(); // last checkpoint and diagnostics, before their metrics go away
+
+    if (recorder)
+    {
+        recorder->finish();
+        std::cout << "Wrote " << recorder->captured() << " frames to " << options.outputDir << std::endl;
+        delete recorder;
+    }
+
+    delete telemetry;
+    delete predictor;
+    glDeleteBuffers(1, &orbitVBO);
+    glDeleteVertexArrays(1, &orbitVAO);
+    delete domains; // stops the worker processes
+
     glfwTerminate(); // end of glfwInit()
     return 0;
 }
\ No newline at end of file
@@ -217,4 +217,35 @@ public:
             this->velocity.x *= -0.95;
         }
     }
-};
\ No newline at end of file
+};
+
+// what the draw stage needs from a planet, copied out so the next step can run meanwhile
+struct PlanetSnapshot
+{
+    std::vector<float> vertices;
+    Vector3 position;
+    float radius;
+    Color centerColor;
+    Color edgeColor;
+};
+
+// everything draw needs from one step
+struct FrameSnapshot
+{
+    std::vector<PlanetSnapshot> planets;
+    double simTime; // simulation time the planets were copied at
+};
+
+void fillSnapshots(const std::vector<Body>& planets, std::vector<PlanetSnapshot>& snapshots)
+{
+    snapshots.resize(planets.size());
+    for (int i = 0; i < planets.size(); i++)
+    {
+        // assign reuses the snapshot's storage after the first frame
+        snapshots[i].vertices.assign(planets[i].vertices.begin(), planets[i].vertices.end());
+        snapshots[i].position = planets[i].position;
+        snapshots[i].radius = planets[i].radius;
+        snapshots[i].centerColor = planets[i].centerColor;
+        snapshots[i].edgeColor = planets[i].edgeColor;
+    }
+}
\ No newline at end of file
@@ -14,6 +14,16 @@ const float gravityConstant = 6.674e-15f; // scaled universal gravitational cons
 
 const double PI = 3.1415926535897;
 
+// plummer softening for the force loop. close pairs are regularized instead
+// (see encounter.h), so this is off by default
+const float softeningLength = 0.0f;
+
+// a regularized pair is only exact between its two members. a third body that
+// comes within the encounter radius of a pair is not regularized with it, so its
+// interaction with either member keeps this much softening instead of going
+// singular. farther out the pair is a point mass and nothing is softened
+const float pairMemberSoftening = 0.1f;
+
 // camera vars
 glm::vec3 cameraPos = glm::vec3(0.0f, 3.0f, 1.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, -1.0f, -1.0f);
@@ -0,0 +1,551 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+
+#include "structs.h"
+#include "body.h"
+#include "forces.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <cerrno>
+#include <sys/prctl.h>
+#include <signal.h>
+#endif
+
+// spreads the force computation over several local worker processes.
+// bodies are ordered along a morton curve and cut into one contiguous domain
+// per worker; cuts move every step so each domain gets about the same share of
+// the measured cost from the previous step. everything is exchanged through one
+// POSIX shared memory segment, so nothing leaves the box. the parent only
+// publishes raw positions and the morton order; each worker copies its own
+// bodies into a region of the segment that only it writes, so on a numa machine
+// the first touch puts that region on the worker's node. summaries and
+// accelerations are computed there too, and another domain's region is only read
+// when the opening test fails for it.
+
+static const int maxDomains = 64;
+static const int maxSharedBodies = 1 << 18; // each region is sized for this many, pages are touched lazily
+
+// a body as the parent publishes it, in the caller's order
+struct SharedInput
+{
+    float x, y, z, mass;
+    float cx, cy, cz; // pair center of mass, or the position again when unpaired
+    int partner;      // caller index of a regularized pair partner or -1
+};
+
+struct SharedBody
+{
+    float x, y, z, mass;
+    float cx, cy, cz; // as SharedInput
+    float ax, ay, az;
+    int index;   // position in the caller's body list
+    int partner; // slot of a regularized pair partner (excluded from the sum) or -1
+};
+
+// everything another domain needs to know about this one: its bodies (by range)
+// and a monopole for when it is far enough away to not need them
+struct DomainSummary
+{
+    int begin, end;
+    float mass;
+    float cx, cy, cz; // center of mass
+    float size;       // largest bounding box extent
+    int64_t costNs;   // force time measured by the owning worker
+    int64_t interactions; // force evaluations by the owning worker, a domain's monopole counts as one
+};
+
+struct SharedHeader
+{
+#ifdef __linux__
+    sem_t start[maxDomains];
+    sem_t done;
+    pthread_barrier_t summarized; // every domain has gathered its bodies and summary
+#endif
+    int shutdown;
+    int domainCount;
+    float theta; // opening angle for remote domains, 0 = always exact
+    float nearRadius; // pairs are point masses beyond this, see interactionPoints
+    DomainSummary domains[maxDomains];
+};
+
+class DomainDecomposition
+{
+private:
+    int workers;
+    int capacity;
+    size_t regionStride; // bytes between two domains' regions, whole pages
+    size_t segmentSize;
+    SharedHeader* header;
+    SharedInput* input;
+    int* order;  // sorted slot -> caller index
+    int* slot;   // inverse of order
+    char* regions;
+    std::vector<int> pids;
+
+    std::vector<uint32_t> keys;
+    int sortedCount; // bodies in order[] from the previous step
+    std::vector<float> weights; // per-body cost estimate, indexed like the caller's list
+    bool failed;           // a worker died, the rest were stopped
+    bool reportedCapacity; // warned once that the bodies don't fit
+    int64_t evaluated;     // force evaluations summed over the workers in the last step
+
+    // spread 10 bits so there are two zero bits between each
+    static uint32_t expandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static uint32_t mortonKey(float x, float y, float z)
+    {
+        auto quantize = [](float t) {
+            return static_cast<uint32_t>(std::min(std::max(t * 1024.0f, 0.0f), 1023.0f));
+        };
+        return (expandBits(quantize(x)) << 2) | (expandBits(quantize(y)) << 1) | expandBits(quantize(z));
+    }
+
+    static SharedBody* region(char* regions, size_t stride, int domain)
+    {
+        return reinterpret_cast<SharedBody*>(regions + stride * domain);
+    }
+
+    // copies this domain's bodies out of the published input and summarizes them
+    static void gatherDomain(SharedHeader* header, const SharedInput* input, const int* order, const int* slot,
+                             SharedBody* own, int domain)
+    {
+        DomainSummary& summary = header->domains[domain];
+        summary.mass = 0.0f;
+        Vector3 weighted(0.0f, 0.0f, 0.0f);
+        Vector3 boxLow(0.0f, 0.0f, 0.0f), boxHigh(0.0f, 0.0f, 0.0f);
+        for (int k = summary.begin; k < summary.end; k++)
+        {
+            const SharedInput& body = input[order[k]];
+            Vector3 position(body.x, body.y, body.z);
+            own[k - summary.begin] = SharedBody{body.x, body.y, body.z, body.mass, body.cx, body.cy, body.cz,
+                                                0.0f, 0.0f, 0.0f, order[k], body.partner >= 0 ? slot[body.partner] : -1};
+            summary.mass += body.mass;
+            weighted += position * body.mass;
+            if (k == summary.begin) boxLow = boxHigh = position;
+            boxLow = Vector3(std::min(boxLow.x, position.x), std::min(boxLow.y, position.y), std::min(boxLow.z, position.z));
+            boxHigh = Vector3(std::max(boxHigh.x, position.x), std::max(boxHigh.y, position.y), std::max(boxHigh.z, position.z));
+        }
+        Vector3 center(summary.mass > 0.0f ? weighted * (1.0f / summary.mass) : weighted);
+        summary.cx = center.x;
+        summary.cy = center.y;
+        summary.cz = center.z;
+        summary.size = std::max({boxHigh.x - boxLow.x, boxHigh.y - boxLow.y, boxHigh.z - boxLow.z});
+    }
+
+    // returns the number of force evaluations
+    static int64_t computeDomain(SharedHeader* header, char* regions, size_t stride, int domain)
+    {
+        const DomainSummary& own = header->domains[domain];
+        SharedBody* ownBodies = region(regions, stride, domain);
+        int64_t evaluations = 0;
+
+        for (int i = own.begin; i < own.end; i++)
+        {
+            SharedBody& body = ownBodies[i - own.begin];
+            Vector3 position(body.x, body.y, body.z);
+            Vector3 bodyCenter(body.cx, body.cy, body.cz);
+            bool paired = body.partner >= 0;
+            Vector3 totalAcceleration(0.0f, 0.0f, 0.0f);
+
+            for (int d = 0; d < header->domainCount; d++)
+            {
+                const DomainSummary& other = header->domains[d];
+                if (d != domain && header->theta > 0.0f)
+                {
+                    Vector3 center(other.cx, other.cy, other.cz);
+                    Vector3 offset(center - bodyCenter);
+                    float dist = sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z);
+                    bool holdsPartner = body.partner >= other.begin && body.partner < other.end;
+                    if (other.size < header->theta * dist && !holdsPartner)
+                    {
+                        totalAcceleration += pairAcceleration(bodyCenter, center, other.mass);
+                        evaluations++;
+                        continue;
+                    }
+                }
+                // the only place another worker's region is read
+                const SharedBody* otherBodies = region(regions, stride, d);
+                for (int j = other.begin; j < other.end; j++)
+                {
+                    if (i == j || j == body.partner) continue;
+                    const SharedBody& source = otherBodies[j - other.begin];
+                    totalAcceleration += interactionAcceleration(position, bodyCenter, paired,
+                                                                 Vector3(source.x, source.y, source.z),
+                                                                 Vector3(source.cx, source.cy, source.cz), source.partner >= 0,
+                                                                 source.mass, header->nearRadius);
+                    evaluations++;
+                }
+            }
+            body.ax = totalAcceleration.x;
+            body.ay = totalAcceleration.y;
+            body.az = totalAcceleration.z;
+        }
+        return evaluations;
+    }
+
+#ifdef __linux__
+    static void workerLoop(SharedHeader* header, const SharedInput* input, const int* order, const int* slot,
+                           char* regions, size_t stride, int domain, int workers)
+    {
+        // spread workers evenly over the cpus so they land on different numa nodes;
+        // pinned before the region is first written so its pages follow the worker
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(static_cast<int>(domain * cpus / workers), &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+
+        using Clock = std::chrono::steady_clock;
+        while (true)
+        {
+            while (sem_wait(&header->start[domain]) != 0) {}
+            if (header->shutdown) _exit(0);
+
+            auto begin = Clock::now();
+            gatherDomain(header, input, order, slot, region(regions, stride, domain), domain);
+            auto gathered = Clock::now();
+
+            // remote summaries must be complete before the opening tests
+            pthread_barrier_wait(&header->summarized);
+
+            auto forces = Clock::now();
+            header->domains[domain].interactions = computeDomain(header, regions, stride, domain);
+            header->domains[domain].costNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                (gathered - begin) + (Clock::now() - forces)).count();
+
+            sem_post(&header->done);
+        }
+    }
+#endif
+
+#ifdef __linux__
+    // reaps any worker that has exited, true if there was one
+    bool reapExited(bool report)
+    {
+        bool exited = false;
+        for (int k = 0; k < pids.size(); )
+        {
+            int status;
+            if (waitpid(pids[k], &status, WNOHANG) == pids[k])
+            {
+                if (report)
+                    std::cerr << "Domain worker " << pids[k] << (WIFSIGNALED(status) ? " was killed by signal " : " exited with status ")
+                          << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)) << std::endl;
+                pids.erase(pids.begin() + k);
+                exited = true;
+                continue;
+            }
+            k++;
+        }
+        return exited;
+    }
+
+    // asks every worker to exit, then kills whatever has not after graceMs; a
+    // worker stuck behind a dead one in the barrier never sees the request
+    void stopWorkers(int graceMs)
+    {
+        header->shutdown = 1;
+        for (int d = 0; d < workers; d++) sem_post(&header->start[d]);
+        for (int waited = 0; !pids.empty() && waited < graceMs; waited += 10)
+        {
+            reapExited(false);
+            if (!pids.empty()) usleep(10000);
+        }
+        for (int pid : pids)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        pids.clear();
+    }
+
+    // waits for every worker's done post, false as soon as one of them has died
+    bool awaitWorkers()
+    {
+        for (int finished = 0; finished < workers; )
+        {
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100000000; // check on the workers every 100ms
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (sem_timedwait(&header->done, &deadline) == 0)
+                finished++;
+            else if (errno == ETIMEDOUT && reapExited(true))
+                return false;
+        }
+        return true;
+    }
+#endif
+
+    // contiguous morton ranges holding equal shares of the estimated cost
+    void cutDomains(int count)
+    {
+        float total = 0.0f;
+        for (int i = 0; i < count; i++) total += weights[order[i]];
+
+        int begin = 0;
+        float running = 0.0f;
+        for (int d = 0; d < workers; d++)
+        {
+            float target = total * static_cast<float>(d + 1) / workers;
+            int end = begin;
+            while (end < count && (d == workers - 1 || running + weights[order[end]] * 0.5f <= target))
+                running += weights[order[end++]];
+
+            DomainSummary& summary = header->domains[d];
+            summary.begin = begin;
+            summary.end = end;
+            begin = end;
+        }
+    }
+
+    // bodies barely move between steps, so the previous order is nearly sorted and
+    // an insertion sort over it is close to linear; falls back to a full sort when
+    // the count changed or too much has moved
+    void sortAlongCurve(int count, bool reuse)
+    {
+        auto byKey = [this](int a, int b) { return keys[a] < keys[b]; };
+        if (reuse)
+        {
+            long moves = 0, budget = 8L * count;
+            for (int k = 1; k < count; k++)
+            {
+                int body = order[k];
+                int j = k;
+                while (j > 0 && keys[order[j - 1]] > keys[body] && moves++ < budget)
+                {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = body;
+            }
+            if (moves <= budget) return;
+        }
+        else
+            std::iota(order, order + count, 0);
+        std::sort(order, order + count, byKey);
+    }
+
+public:
+    DomainDecomposition(int workers, int capacity) :
+        workers{std::min(std::max(workers, 1), maxDomains)},
+        capacity{capacity},
+        regionStride{0},
+        segmentSize{0},
+        header{nullptr},
+        input{nullptr},
+        order{nullptr},
+        slot{nullptr},
+        regions{nullptr},
+        sortedCount{0},
+        failed{false},
+        reportedCapacity{false},
+        evaluated{0}
+    {
+#ifdef __linux__
+        // header and published input first, then one page aligned region per domain
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto wholePages = [page](size_t bytes) { return (bytes + page - 1) / page * page; };
+        size_t shared = wholePages(sizeof(SharedHeader) + (sizeof(SharedInput) + 2 * sizeof(int)) * capacity);
+        regionStride = wholePages(sizeof(SharedBody) * capacity);
+        segmentSize = shared + regionStride * this->workers;
+
+        // unlinked as soon as it is mapped, forked workers inherit the mapping
+        std::string name = "/gravity-" + std::to_string(getpid());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, segmentSize) != 0)
+        {
+            std::cerr << "Failed to create shared memory segment " << name << std::endl;
+            if (fd >= 0) close(fd);
+            shm_unlink(name.c_str());
+            return;
+        }
+        void* segment = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        shm_unlink(name.c_str());
+        if (segment == MAP_FAILED)
+        {
+            std::cerr << "Failed to map shared memory segment " << name << std::endl;
+            return;
+        }
+
+        header = static_cast<SharedHeader*>(segment);
+        input = reinterpret_cast<SharedInput*>(static_cast<char*>(segment) + sizeof(SharedHeader));
+        order = reinterpret_cast<int*>(input + capacity);
+        slot = order + capacity;
+        regions = static_cast<char*>(segment) + shared;
+        header->shutdown = 0;
+        header->domainCount = 0;
+        header->theta = 0.0f;
+        header->nearRadius = 0.0f;
+        sem_init(&header->done, 1, 0);
+        for (int d = 0; d < maxDomains; d++)
+        {
+            header->domains[d] = DomainSummary{0, 0, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0};
+            if (d < this->workers) sem_init(&header->start[d], 1, 0);
+        }
+
+        pid_t parent = getpid();
+        for (int d = 0; d < this->workers; d++)
+        {
+            int pid = fork();
+            if (pid == 0)
+            {
+                // don't outlive the parent if it dies without running the destructor;
+                // if it already exited before prctl the child was reparented
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+                if (getppid() != parent) _exit(0);
+                // ctrl+c reaches the whole process group; the parent stops the
+                // workers itself once its loop has wound down
+                signal(SIGINT, SIG_IGN);
+                workerLoop(header, input, order, slot, regions, regionStride, d, this->workers);
+            }
+            if (pid < 0)
+            {
+                std::cerr << "Failed to start domain worker " << d << std::endl;
+                this->workers = d;
+                break;
+            }
+            pids.push_back(pid);
+        }
+        header->domainCount = this->workers;
+        pthread_barrierattr_t attributes;
+        pthread_barrierattr_init(&attributes);
+        pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_barrier_init(&header->summarized, &attributes, std::max(this->workers, 1));
+        pthread_barrierattr_destroy(&attributes);
+        std::cout << "Force computation split over " << this->workers << " worker processes" << std::endl;
+#else
+        std::cerr << "Multi-process domain decomposition is only supported on Linux" << std::endl;
+#endif
+    }
+
+    ~DomainDecomposition()
+    {
+#ifdef __linux__
+        if (!header) return;
+        stopWorkers(1000);
+        // a killed worker may have left the barrier mid-wait, destroying it would block
+        if (!failed) pthread_barrier_destroy(&header->summarized);
+        munmap(header, segmentSize);
+#endif
+    }
+
+    bool active() const { return header != nullptr && workers > 0 && !failed; }
+    int64_t interactions() const { return evaluated; }
+
+    // approximate remote domains by their monopole once size/distance < theta
+    void setOpeningAngle(float theta) { if (header) header->theta = theta; }
+
+    // fills in acceleration for every body, leaving out each body's pair partner
+    // (partner[i], -1 for none). center and nearRadius place pair members as the
+    // in-process loop does (interactionPoints). returns false if it could not
+    bool computeAccelerations(std::vector<Body*>& planets, const std::vector<int>& partner,
+                              const std::vector<Vector3>& center, float nearRadius)
+    {
+#ifdef __linux__
+        int count = static_cast<int>(planets.size());
+        if (!active()) return false;
+        if (count > capacity)
+        {
+            if (!reportedCapacity)
+            {
+                std::cerr << count << " bodies do not fit the shared segment (" << capacity
+                          << "), computing forces in this process" << std::endl;
+                reportedCapacity = true;
+            }
+            return false;
+        }
+
+        if (static_cast<int>(weights.size()) != count) weights.assign(count, 1.0f);
+
+        Vector3 low = planets[0]->position, high = planets[0]->position;
+        for (Body* planet : planets)
+        {
+            low = Vector3(std::min(low.x, planet->position.x), std::min(low.y, planet->position.y), std::min(low.z, planet->position.z));
+            high = Vector3(std::max(high.x, planet->position.x), std::max(high.y, planet->position.y), std::max(high.z, planet->position.z));
+        }
+        float extent = std::max({high.x - low.x, high.y - low.y, high.z - low.z, 1e-6f});
+
+        // publish positions in the caller's order, each worker picks out its own
+        keys.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            const Body* planet = planets[i];
+            Vector3 p((planet->position - low) * (1.0f / extent));
+            keys[i] = mortonKey(p.x, p.y, p.z);
+            input[i] = SharedInput{planet->position.x, planet->position.y, planet->position.z, planet->mass,
+                                   center[i].x, center[i].y, center[i].z, partner[i]};
+        }
+
+        // migrate: re-sort along the morton curve from this step's positions
+        sortAlongCurve(count, sortedCount == count);
+        sortedCount = count;
+        for (int k = 0; k < count; k++) slot[order[k]] = k;
+
+        cutDomains(count);
+        header->nearRadius = nearRadius;
+
+        for (int d = 0; d < workers; d++) sem_post(&header->start[d]);
+        if (!awaitWorkers())
+        {
+            std::cerr << "Lost a domain worker, computing forces in this process from now on" << std::endl;
+            stopWorkers(0);
+            failed = true;
+            return false;
+        }
+
+        evaluated = 0;
+        for (int d = 0; d < workers; d++)
+        {
+            const DomainSummary& summary = header->domains[d];
+            evaluated += summary.interactions;
+            const SharedBody* bodies = region(regions, regionStride, d);
+            for (int k = 0; k < summary.end - summary.begin; k++)
+                planets[bodies[k].index]->acceleration = Vector3(bodies[k].ax, bodies[k].ay, bodies[k].az);
+        }
+
+        // rebalance: spread each domain's measured time evenly over its bodies
+        for (int d = 0; d < workers; d++)
+        {
+            const DomainSummary& summary = header->domains[d];
+            int size = summary.end - summary.begin;
+            if (size == 0) continue;
+            float perBody = std::max(static_cast<float>(summary.costNs), 1.0f) / size;
+            for (int k = summary.begin; k < summary.end; k++) weights[order[k]] = perBody;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+};
@@ -0,0 +1,382 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include "constants.h"
+#include "structs.h"
+#include "body.h"
+#include "forces.h"
+
+// close encounters: any two bodies that come within encounterRadius of each other
+// are taken out of the global step and their relative motion is advanced in
+// Kustaanheimo-Stiefel coordinates. in KS variables the two body problem is a
+// harmonic oscillator in fictitious time s (dt = r ds), so the equations stay
+// smooth through pericentre and the pair needs no softening and no small global
+// steps. beyond encounterRadius the rest of the system only sees the pair's
+// center of mass (see interactionPoints in forces.h), and the pair in turn feels
+// the rest through the tidal tensor at its center of mass, applied to the
+// separation as it changes during the step. a third body within encounterRadius
+// is not regularized; its interaction with either member is softened by
+// pairMemberSoftening instead.
+
+struct KSPair
+{
+    int a, b;      // indices into the system's body list, relative vector is b - a
+    double mu;     // G * (m_a + m_b)
+    double u[4];   // KS coordinates
+    double up[4];  // du/ds
+    double h;      // specific binding energy, negative when bound
+};
+
+class EncounterManager
+{
+private:
+    std::vector<Vector3> around; // centers() at the start of advance()
+    std::vector<std::pair<uint64_t, int>> cells; // free bodies by grid cell, sorted, for detect()
+
+    // cubes of encounterRadius, so a body's candidates are all in the 27 cells
+    // around its own. the packing wraps far out, which only adds candidates
+    uint64_t cellKey(int64_t x, int64_t y, int64_t z) const
+    {
+        // biased so the wrap is a million cells out rather than at the origin
+        const int64_t bias = 1 << 20;
+        const uint64_t mask = (1u << 21) - 1;
+        return ((static_cast<uint64_t>(x + bias) & mask) << 42) | ((static_cast<uint64_t>(y + bias) & mask) << 21)
+               | (static_cast<uint64_t>(z + bias) & mask);
+    }
+
+    void cellOf(const Vector3& p, int64_t cell[3]) const
+    {
+        cell[0] = static_cast<int64_t>(std::floor(p.x / encounterRadius));
+        cell[1] = static_cast<int64_t>(std::floor(p.y / encounterRadius));
+        cell[2] = static_cast<int64_t>(std::floor(p.z / encounterRadius));
+    }
+
+    struct KSState
+    {
+        double u[4], up[4], h, t;
+    };
+
+    // L(u)^T applied to a 3-vector padded with a zero fourth component
+    static void transposeApply(const double u[4], const double p[3], double out[4])
+    {
+        out[0] =  u[0] * p[0] + u[1] * p[1] + u[2] * p[2];
+        out[1] = -u[1] * p[0] + u[0] * p[1] + u[3] * p[2];
+        out[2] = -u[2] * p[0] - u[3] * p[1] + u[0] * p[2];
+        out[3] =  u[3] * p[0] - u[2] * p[1] + u[1] * p[2];
+    }
+
+    // first three rows of L(u) applied to a 4-vector
+    static void apply(const double u[4], const double w[4], double out[3])
+    {
+        out[0] = u[0] * w[0] - u[1] * w[1] - u[2] * w[2] + u[3] * w[3];
+        out[1] = u[1] * w[0] + u[0] * w[1] - u[3] * w[2] - u[2] * w[3];
+        out[2] = u[2] * w[0] + u[3] * w[1] + u[0] * w[2] + u[1] * w[3];
+    }
+
+    static double radius(const double u[4])
+    {
+        return u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+    }
+
+    // d/ds of (u, u', h, t), perturbed by tidal tensor T (row major) applied to
+    // the current separation
+    static KSState derivative(const KSState& y, const double tidal[9])
+    {
+        double r = radius(y.u);
+        double x[3];
+        apply(y.u, y.u, x);
+        double p[3];
+        for (int row = 0; row < 3; row++)
+            p[row] = tidal[row * 3] * x[0] + tidal[row * 3 + 1] * x[1] + tidal[row * 3 + 2] * x[2];
+
+        double lp[4];
+        transposeApply(y.u, p, lp);
+
+        KSState d;
+        d.h = 0.0;
+        for (int k = 0; k < 4; k++)
+        {
+            d.u[k] = y.up[k];
+            d.up[k] = 0.5 * y.h * y.u[k] + 0.5 * r * lp[k];
+            d.h += 2.0 * y.up[k] * lp[k];
+        }
+        d.t = r;
+        return d;
+    }
+
+    static KSState offset(const KSState& y, const KSState& d, double ds)
+    {
+        KSState out;
+        for (int k = 0; k < 4; k++)
+        {
+            out.u[k] = y.u[k] + d.u[k] * ds;
+            out.up[k] = y.up[k] + d.up[k] * ds;
+        }
+        out.h = y.h + d.h * ds;
+        out.t = y.t + d.t * ds;
+        return out;
+    }
+
+    static void rungeKutta(KSState& y, const double tidal[9], double ds)
+    {
+        KSState k1 = derivative(y, tidal);
+        KSState k2 = derivative(offset(y, k1, 0.5 * ds), tidal);
+        KSState k3 = derivative(offset(y, k2, 0.5 * ds), tidal);
+        KSState k4 = derivative(offset(y, k3, ds), tidal);
+        for (int k = 0; k < 4; k++)
+        {
+            y.u[k] += ds / 6.0 * (k1.u[k] + 2.0 * k2.u[k] + 2.0 * k3.u[k] + k4.u[k]);
+            y.up[k] += ds / 6.0 * (k1.up[k] + 2.0 * k2.up[k] + 2.0 * k3.up[k] + k4.up[k]);
+        }
+        y.h += ds / 6.0 * (k1.h + 2.0 * k2.h + 2.0 * k3.h + k4.h);
+        y.t += ds / 6.0 * (k1.t + 2.0 * k2.t + 2.0 * k3.t + k4.t);
+    }
+
+    // d(acceleration)/d(position) at the pair's center `at` due to every body
+    // outside the pair: sum of G m (3 d d^T / s^5 - I / s^3) with d from `at` to
+    // the body and s^2 = |d|^2 + softening^2, both placed the way the force loop
+    // places them (interactionPoints)
+    void tidalTensor(const std::vector<Body*>& planets, const KSPair& pair, const Vector3& at,
+                     const std::vector<Vector3>& around, double tidal[9]) const
+    {
+        for (int k = 0; k < 9; k++) tidal[k] = 0.0;
+        for (int i = 0; i < planets.size(); i++)
+        {
+            if (i == pair.a || i == pair.b) continue;
+            Vector3 from, to;
+            float softening;
+            interactionPoints(at, at, true, planets[i]->position, around[i], partner[i] >= 0, encounterRadius,
+                              from, to, softening);
+            double d[3] = {static_cast<double>(to.x) - at.x,
+                           static_cast<double>(to.y) - at.y,
+                           static_cast<double>(to.z) - at.z};
+            double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + static_cast<double>(softening) * softening;
+            if (r2 == 0.0) continue;
+            double gm = static_cast<double>(gravityConstant) * planets[i]->mass;
+            double inverse3 = gm / (r2 * sqrt(r2));
+            double inverse5 = 3.0 * inverse3 / r2;
+            for (int row = 0; row < 3; row++)
+            {
+                for (int col = 0; col < 3; col++)
+                    tidal[row * 3 + col] += inverse5 * d[row] * d[col] - (row == col ? inverse3 : 0.0);
+            }
+        }
+    }
+
+    // relative position/velocity -> KS coordinates
+    static void regularize(KSPair& pair, const Vector3& relPosition, const Vector3& relVelocity)
+    {
+        double x[3] = {relPosition.x, relPosition.y, relPosition.z};
+        double v[3] = {relVelocity.x, relVelocity.y, relVelocity.z};
+        double r = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+
+        // pick the branch that avoids dividing by a small component
+        if (x[0] >= 0.0)
+        {
+            pair.u[0] = sqrt(0.5 * (r + x[0]));
+            pair.u[1] = 0.5 * x[1] / pair.u[0];
+            pair.u[2] = 0.5 * x[2] / pair.u[0];
+            pair.u[3] = 0.0;
+        }
+        else
+        {
+            pair.u[1] = sqrt(0.5 * (r - x[0]));
+            pair.u[0] = 0.5 * x[1] / pair.u[1];
+            pair.u[3] = 0.5 * x[2] / pair.u[1];
+            pair.u[2] = 0.0;
+        }
+
+        double lv[4];
+        transposeApply(pair.u, v, lv);
+        for (int k = 0; k < 4; k++) pair.up[k] = 0.5 * lv[k];
+
+        pair.h = 0.5 * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) - pair.mu / r;
+    }
+
+    // KS coordinates -> relative position/velocity
+    static void physical(const KSPair& pair, Vector3& relPosition, Vector3& relVelocity)
+    {
+        double x[3], w[3];
+        apply(pair.u, pair.u, x);
+        apply(pair.u, pair.up, w);
+        double r = radius(pair.u);
+        relPosition = Vector3(x[0], x[1], x[2]);
+        relVelocity = Vector3(2.0 * w[0] / r, 2.0 * w[1] / r, 2.0 * w[2] / r);
+    }
+
+public:
+    float encounterRadius; // pairs closer than this are regularized
+    float releaseRadius;   // and handed back to the global step beyond this
+    int stepsPerOrbit;     // fictitious-time resolution of a bound orbit
+    std::vector<KSPair> pairs;
+    std::vector<int> partner; // per body, the index of its pair partner or -1
+
+    EncounterManager() :
+        encounterRadius{0.5f},
+        releaseRadius{1.0f},
+        stepsPerOrbit{64}
+        {};
+
+    // pair up free bodies that have come close
+    void detect(std::vector<Body*>& planets)
+    {
+        if (partner.size() != planets.size()) partner.assign(planets.size(), -1);
+        if (encounterRadius <= 0.0f) return;
+
+        cells.clear();
+        for (int i = 0; i < planets.size(); i++)
+        {
+            if (partner[i] >= 0) continue;
+            int64_t cell[3];
+            cellOf(planets[i]->position, cell);
+            cells.emplace_back(cellKey(cell[0], cell[1], cell[2]), i);
+        }
+        std::sort(cells.begin(), cells.end());
+
+        for (int i = 0; i < planets.size(); i++)
+        {
+            if (partner[i] >= 0) continue;
+
+            // closest free body after i, ties to the lower index
+            int closest = -1;
+            float closestDistance = encounterRadius;
+            int64_t cell[3];
+            cellOf(planets[i]->position, cell);
+            for (int n = 0; n < 9; n++)
+            {
+                // z is the low part of the key, so the three cells along z are one run
+                int64_t x = cell[0] + n % 3 - 1, y = cell[1] + n / 3 - 1;
+                uint64_t low = cellKey(x, y, cell[2] - 1), high = cellKey(x, y, cell[2] + 1);
+                if (high < low) low = cellKey(x, y, -(1 << 20)), high = cellKey(x, y, (1 << 20) - 1); // wrapped, whole column
+                auto first = std::lower_bound(cells.begin(), cells.end(), std::make_pair(low, 0));
+                for (auto it = first; it != cells.end() && it->first <= high; ++it)
+                {
+                    int j = it->second;
+                    if (j <= i || partner[j] >= 0) continue;
+                    Vector3 d(planets[j]->position - planets[i]->position);
+                    float distance = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+                    if (distance < closestDistance || (distance == closestDistance && closest >= 0 && j < closest))
+                    {
+                        closest = j;
+                        closestDistance = distance;
+                    }
+                }
+            }
+            if (closest < 0) continue;
+
+            KSPair pair;
+            pair.a = i;
+            pair.b = closest;
+            pair.mu = static_cast<double>(gravityConstant) * (static_cast<double>(planets[i]->mass) + planets[closest]->mass);
+            regularize(pair,
+                       planets[closest]->position - planets[i]->position,
+                       planets[closest]->velocity - planets[i]->velocity);
+            pairs.push_back(pair);
+            partner[i] = closest;
+            partner[closest] = i;
+        }
+    }
+
+    // per body: its pair's center of mass, or its own position when unpaired
+    void centers(const std::vector<Body*>& planets, std::vector<Vector3>& out) const
+    {
+        out.resize(planets.size());
+        for (int i = 0; i < planets.size(); i++) out[i] = planets[i]->position;
+        for (const KSPair& pair : pairs)
+        {
+            const Body* a = planets[pair.a];
+            const Body* b = planets[pair.b];
+            Vector3 center((a->position * a->mass + b->position * b->mass) * (1.0f / (a->mass + b->mass)));
+            out[pair.a] = center;
+            out[pair.b] = center;
+        }
+    }
+
+    // moves every pair forward by deltaTime. the members' accelerations must hold
+    // only what the rest of the system exerts on them (the force loop skips partners)
+    void advance(std::vector<Body*>& planets, float deltaTime)
+    {
+        centers(planets, around);
+        for (int n = 0; n < pairs.size(); )
+        {
+            KSPair& pair = pairs[n];
+            Body* a = planets[pair.a];
+            Body* b = planets[pair.b];
+            float totalMass = a->mass + b->mass;
+
+            // center of mass moves like any other body under the mass weighted external pull
+            Vector3 center((a->position * a->mass + b->position * b->mass) * (1.0f / totalMass));
+            Vector3 centerVelocity((a->velocity * a->mass + b->velocity * b->mass) * (1.0f / totalMass));
+            Vector3 centerAcceleration((a->acceleration * a->mass + b->acceleration * b->mass) * (1.0f / totalMass));
+
+            // tidal part of the external pull drives the internal motion; the
+            // tensor is fixed for the step, the separation it acts on is not
+            double tidal[9];
+            tidalTensor(planets, pair, center, around, tidal);
+
+            centerVelocity += centerAcceleration * deltaTime;
+            center += centerVelocity * deltaTime;
+
+            KSState y;
+            for (int k = 0; k < 4; k++)
+            {
+                y.u[k] = pair.u[k];
+                y.up[k] = pair.up[k];
+            }
+            y.h = pair.h;
+            y.t = 0.0;
+
+            // nominal fictitious step: a fixed fraction of the orbit when bound,
+            // otherwise the free-fall scale at the encounter radius
+            double dsNominal = 0.1 * sqrt(encounterRadius / pair.mu);
+            if (pair.h < 0.0)
+                dsNominal = std::min(dsNominal, 2.0 * PI / (sqrt(-0.5 * pair.h) * stepsPerOrbit));
+
+            double target = deltaTime;
+            for (int iteration = 0; iteration < 100000; iteration++)
+            {
+                double remaining = target - y.t;
+                if (fabs(remaining) <= 1e-12 * std::max(1.0, target)) break;
+                // dt = r ds, so remaining / r lands close to the target and a few
+                // of these corrections converge onto it
+                double ds = remaining / radius(y.u);
+                if (fabs(ds) > dsNominal) ds = ds > 0.0 ? dsNominal : -dsNominal;
+                rungeKutta(y, tidal, ds);
+            }
+
+            for (int k = 0; k < 4; k++)
+            {
+                pair.u[k] = y.u[k];
+                pair.up[k] = y.up[k];
+            }
+            pair.h = y.h;
+
+            Vector3 relPosition, relVelocity;
+            physical(pair, relPosition, relVelocity);
+
+            a->replacePosition(center - relPosition * (b->mass / totalMass));
+            b->replacePosition(center + relPosition * (a->mass / totalMass));
+            a->replaceVelocity(centerVelocity - relVelocity * (b->mass / totalMass));
+            b->replaceVelocity(centerVelocity + relVelocity * (a->mass / totalMass));
+            a->updateSphereVertices();
+            b->updateSphereVertices();
+
+            // hand the pair back once it has separated
+            float separation = sqrtf(relPosition.x * relPosition.x + relPosition.y * relPosition.y + relPosition.z * relPosition.z);
+            if (separation > releaseRadius)
+            {
+                partner[pair.a] = -1;
+                partner[pair.b] = -1;
+                pairs[n] = pairs.back();
+                pairs.pop_back();
+                continue;
+            }
+            n++;
+        }
+    }
+};
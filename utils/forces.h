@@ -0,0 +1,56 @@
+#pragma once
+#include <cmath>
+#include "constants.h"
+#include "structs.h"
+
+// gravitational acceleration on a body at `at` due to a mass at `source`
+// (mass of the accelerated body reduces to 1)
+Vector3 pairAcceleration(const Vector3& at, const Vector3& source, float sourceMass, float softening = softeningLength)
+{
+    Vector3 distance(source - at);
+
+    float r = sqrtf(pow(distance.x, 2) + pow(distance.y, 2) + pow(distance.z, 2) + softening * softening);
+    if (r == 0.0f) return Vector3(0.0f, 0.0f, 0.0f); // coincident, no defined direction
+
+    // gravitational acceleration magnitude
+    float a = (gravityConstant * sourceMass) / pow(r, 2);
+
+    Vector3 unitVector(distance.x/r, distance.y/r, distance.z/r);
+
+    return unitVector*a;
+}
+
+// where two bodies interact from when either may be a member of a regularized
+// pair. `center` is a member's pair center of mass, or the body's own position.
+// once the centers are nearRadius apart a pair is seen as a point mass at its
+// center (each member puts its own mass there, so the two add up to the pair);
+// closer than that the members are resolved and softened by pairMemberSoftening
+void interactionPoints(const Vector3& at, const Vector3& atCenter, bool atPaired,
+                       const Vector3& source, const Vector3& sourceCenter, bool sourcePaired,
+                       float nearRadius, Vector3& from, Vector3& to, float& softening)
+{
+    from = at;
+    to = source;
+    softening = softeningLength;
+    if (!atPaired && !sourcePaired) return;
+
+    Vector3 d(sourceCenter - atCenter);
+    if (d.x * d.x + d.y * d.y + d.z * d.z >= nearRadius * nearRadius)
+    {
+        from = atCenter;
+        to = sourceCenter;
+    }
+    else
+        softening = pairMemberSoftening;
+}
+
+// pairAcceleration between two bodies placed by interactionPoints
+Vector3 interactionAcceleration(const Vector3& at, const Vector3& atCenter, bool atPaired,
+                                const Vector3& source, const Vector3& sourceCenter, bool sourcePaired,
+                                float sourceMass, float nearRadius)
+{
+    Vector3 from, to;
+    float softening;
+    interactionPoints(at, atCenter, atPaired, source, sourceCenter, sourcePaired, nearRadius, from, to, softening);
+    return pairAcceleration(from, to, sourceMass, softening);
+}
@@ -1,11 +1,21 @@
 #pragma once
 #include <iostream>
+#include <csignal>
 #include <constants.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 // helper methods and callbacks for GLFW
 
+// set by SIGINT/SIGTERM, the main loop checks it next to glfwWindowShouldClose so
+// a killed run still shuts down normally (offscreen runs flush their frames)
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
 // resizing callback for GLFW
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -0,0 +1,404 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+
+#include <glad/glad.h>
+
+// headless rendering: draw into a framebuffer object, read pixels back through a
+// ring of pixel buffer objects and hand them to a worker thread for encoding.
+// glReadPixels into a bound PBO returns immediately, so the pixels are only
+// touched (mapped) a couple of frames later once their fence has signalled.
+
+struct CapturedFrame
+{
+    int index;
+    std::vector<unsigned char> rgba; // bottom-up rows, as GL returns them
+};
+
+// runs on its own thread, writes frames in the order they were captured
+class FrameEncoder
+{
+private:
+    // frames waiting to be encoded; a full frame of pixels each, so submit()
+    // makes the capture side wait rather than let a slow disk grow this forever
+    static const int maxPending = 4;
+
+    int width, height, fps;
+    std::string outputDir;
+    std::string format;
+    std::ofstream video; // y4m stream, opened on the first frame
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained; // signalled when pending gets shorter
+    std::deque<CapturedFrame> pending;
+    std::vector<std::vector<unsigned char>> spare; // recycled pixel buffers
+    bool stopping;
+
+    static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0xFFFFFFFFu)
+    {
+        static uint32_t table[256] = {0};
+        if (table[1] == 0)
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+        }
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+    static void putBigEndian(std::vector<unsigned char>& out, uint32_t value)
+    {
+        out.insert(out.end(), {
+            static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+            static_cast<unsigned char>(value >> 8),  static_cast<unsigned char>(value)
+        });
+    }
+
+    static void writeChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> chunk;
+        chunk.reserve(data.size() + 12);
+        putBigEndian(chunk, static_cast<uint32_t>(data.size()));
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        putBigEndian(chunk, crc32(chunk.data() + 4, data.size() + 4) ^ 0xFFFFFFFFu);
+        file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    }
+
+    // RGB png using stored (uncompressed) deflate blocks, so no zlib dependency
+    void writePng(const CapturedFrame& frame)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%06d.png", frame.index);
+        std::ofstream file(std::filesystem::path(outputDir) / name, std::ios::binary);
+
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        file.write(reinterpret_cast<const char*>(signature), 8);
+
+        std::vector<unsigned char> header;
+        putBigEndian(header, width);
+        putBigEndian(header, height);
+        header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit, truecolor, deflate, no filter, no interlace
+        writeChunk(file, "IHDR", header);
+
+        // filtered scanlines: a 0 (none) filter byte then RGB, flipped to top-down
+        size_t rowSize = 1 + static_cast<size_t>(width) * 3;
+        std::vector<unsigned char> raw(rowSize * height);
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char* src = frame.rgba.data() + static_cast<size_t>(height - 1 - y) * width * 4;
+            unsigned char* dst = raw.data() + y * rowSize;
+            *dst++ = 0;
+            for (int x = 0; x < width; x++)
+            {
+                *dst++ = src[x * 4 + 0];
+                *dst++ = src[x * 4 + 1];
+                *dst++ = src[x * 4 + 2];
+            }
+        }
+
+        std::vector<unsigned char> zlib;
+        zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        zlib.insert(zlib.end(), {0x78, 0x01});
+        uint32_t a = 1, b = 0; // adler32
+        for (size_t offset = 0; ; )
+        {
+            size_t blockSize = std::min<size_t>(65535, raw.size() - offset);
+            bool last = offset + blockSize == raw.size();
+            zlib.insert(zlib.end(), {
+                static_cast<unsigned char>(last ? 1 : 0),
+                static_cast<unsigned char>(blockSize), static_cast<unsigned char>(blockSize >> 8),
+                static_cast<unsigned char>(~blockSize), static_cast<unsigned char>(~blockSize >> 8)
+            });
+            zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+            for (size_t i = offset; i < offset + blockSize; i++)
+            {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            offset += blockSize;
+            if (last) break;
+        }
+        putBigEndian(zlib, (b << 16) | a);
+        writeChunk(file, "IDAT", zlib);
+        writeChunk(file, "IEND", {});
+    }
+
+    // full range BT.601 4:2:0, the "C420jpeg" y4m colorspace
+    void writeY4m(const CapturedFrame& frame)
+    {
+        if (!video.is_open())
+        {
+            video.open(std::filesystem::path(outputDir) / "frames.y4m", std::ios::binary);
+            video << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+        }
+
+        int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+        std::vector<unsigned char> planes(static_cast<size_t>(width) * height + 2 * chromaWidth * chromaHeight);
+        unsigned char* lumaPlane = planes.data();
+        unsigned char* cbPlane = lumaPlane + static_cast<size_t>(width) * height;
+        unsigned char* crPlane = cbPlane + chromaWidth * chromaHeight;
+
+        auto pixel = [&](int x, int y) {
+            // flip to top-down while reading
+            return frame.rgba.data() + (static_cast<size_t>(height - 1 - y) * width + x) * 4;
+        };
+
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const unsigned char* p = pixel(x, y);
+                lumaPlane[y * width + x] = static_cast<unsigned char>(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+            }
+        }
+        for (int cy = 0; cy < chromaHeight; cy++)
+        {
+            for (int cx = 0; cx < chromaWidth; cx++)
+            {
+                // average the 2x2 block, clamped at odd edges
+                float r = 0.0f, g = 0.0f, b = 0.0f;
+                for (int dy = 0; dy < 2; dy++)
+                {
+                    for (int dx = 0; dx < 2; dx++)
+                    {
+                        const unsigned char* p = pixel(std::min(cx * 2 + dx, width - 1), std::min(cy * 2 + dy, height - 1));
+                        r += p[0]; g += p[1]; b += p[2];
+                    }
+                }
+                r *= 0.25f; g *= 0.25f; b *= 0.25f;
+                cbPlane[cy * chromaWidth + cx] = static_cast<unsigned char>(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f);
+                crPlane[cy * chromaWidth + cx] = static_cast<unsigned char>(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f);
+            }
+        }
+
+        video << "FRAME\n";
+        video.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            CapturedFrame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) return; // stopping and drained
+                frame = std::move(pending.front());
+                pending.pop_front();
+            }
+            drained.notify_one();
+
+            if (format == "y4m")
+                writeY4m(frame);
+            else
+                writePng(frame);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::move(frame.rgba));
+        }
+    }
+
+public:
+    FrameEncoder(int width, int height, int fps, const std::string& outputDir, const std::string& format) :
+        width{width},
+        height{height},
+        fps{fps},
+        outputDir{outputDir},
+        format{format},
+        stopping{false}
+    {
+        std::filesystem::create_directories(outputDir);
+        worker = std::thread(&FrameEncoder::run, this);
+    }
+
+    ~FrameEncoder() { finish(); }
+
+    // hands back a buffer from an already encoded frame when one is available
+    std::vector<unsigned char> takeBuffer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (spare.empty()) return {};
+        std::vector<unsigned char> buffer = std::move(spare.back());
+        spare.pop_back();
+        return buffer;
+    }
+
+    // blocks while maxPending frames are already queued
+    void submit(CapturedFrame&& frame)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            drained.wait(lock, [this] { return pending.size() < maxPending; });
+            pending.push_back(std::move(frame));
+        }
+        wake.notify_one();
+    }
+
+    // blocks until every submitted frame is on disk
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+        if (video.is_open()) video.close();
+    }
+};
+
+class FrameRecorder
+{
+private:
+    static const int ringSize = 3;
+
+    int width, height;
+    GLuint fbo, colorRbo, depthRbo;
+    GLuint pbos[ringSize];
+    GLsync fences[ringSize];
+    int slotFrame[ringSize]; // frame index held by each pbo slot
+    int head;                // next slot to read into
+    int tail;                // oldest slot still in flight
+    int inFlight;
+    int framesCaptured;
+    FrameEncoder encoder;
+
+    // map the oldest pbo and pass its pixels to the encoder
+    void collect(bool wait)
+    {
+        GLenum status = glClientWaitSync(fences[tail], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? 1000000000ull : 0);
+        if (status == GL_TIMEOUT_EXPIRED && !wait) return;
+        glDeleteSync(fences[tail]);
+        fences[tail] = 0;
+
+        size_t size = static_cast<size_t>(width) * height * 4;
+        CapturedFrame frame{slotFrame[tail], encoder.takeBuffer()};
+        frame.rgba.resize(size);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[tail]);
+        void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            std::copy(static_cast<unsigned char*>(pixels), static_cast<unsigned char*>(pixels) + size, frame.rgba.begin());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            encoder.submit(std::move(frame));
+        }
+        else
+        {
+            std::cerr << "Failed to map pixel buffer for frame " << slotFrame[tail] << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        tail = (tail + 1) % ringSize;
+        inFlight--;
+    }
+
+public:
+    FrameRecorder(int width, int height, int fps, const std::string& outputDir, const std::string& format) :
+        width{width},
+        height{height},
+        fences{},
+        slotFrame{},
+        head{0},
+        tail{0},
+        inFlight{0},
+        framesCaptured{0},
+        encoder{width, height, fps, outputDir, format}
+    {
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+        glGenRenderbuffers(1, &colorRbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorRbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRbo);
+
+        glGenRenderbuffers(1, &depthRbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRbo);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+
+        glGenBuffers(ringSize, pbos);
+        for (int i = 0; i < ringSize; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    ~FrameRecorder()
+    {
+        glDeleteBuffers(ringSize, pbos);
+        glDeleteRenderbuffers(1, &colorRbo);
+        glDeleteRenderbuffers(1, &depthRbo);
+        glDeleteFramebuffers(1, &fbo);
+    }
+
+    int captured() const { return framesCaptured; }
+
+    // render target for the frame about to be drawn
+    void bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+    }
+
+    // queue an async read of the current framebuffer contents
+    void capture()
+    {
+        // ring full: the oldest read has had ringSize frames to complete
+        if (inFlight == ringSize) collect(true);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[head]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slotFrame[head] = framesCaptured++;
+        head = (head + 1) % ringSize;
+        inFlight++;
+
+        // pick up any earlier reads that are already done, without blocking
+        while (inFlight > 0)
+        {
+            int before = inFlight;
+            collect(false);
+            if (inFlight == before) break;
+        }
+    }
+
+    // drain the pbo ring and wait for the encoder to write everything out
+    void finish()
+    {
+        while (inFlight > 0) collect(true);
+        encoder.finish();
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+// command line options for a run
+
+struct RunOptions
+{
+    bool offscreen;          // render into a framebuffer object instead of a visible window
+    std::string outputDir;   // where captured frames are written
+    std::string format;      // "png" (one file per frame) or "y4m" (single raw video stream)
+    std::string context;     // "native", "egl" or "osmesa" (software, no display needed)
+    int frames;              // stop after this many captured frames (0 = run until closed)
+    int fps;                 // playback rate written into the y4m header
+    float frameInterval;     // simulation time between captured frames
+    float timeStep;          // fixed simulation step used when offscreen
+    int workers;             // force worker processes (0 = compute in this process)
+    float theta;             // opening angle for remote domains (0 = always exact)
+    int diagnostics;         // frames between energy reports (0 = off)
+    std::string checkpoint;  // checkpoint file, empty = off
+    int checkpointEvery;     // frames between checkpoints
+    int graphDump;           // frames between frame-graph timing dumps (0 = off)
+    float predictHorizon;    // how far ahead orbit previews look (0 = off)
+    std::string telemetry;   // unix socket to publish metrics on, empty = off
+
+    RunOptions() :
+        offscreen{false},
+        outputDir{"frames"},
+        format{"png"},
+        context{"native"},
+        frames{0},
+        fps{30},
+        frameInterval{1.0f / 30.0f},
+        timeStep{1.0f / 120.0f},
+        workers{0},
+        theta{0.5f},
+        diagnostics{0},
+        checkpoint{},
+        checkpointEvery{600},
+        graphDump{0},
+        predictHorizon{45.0f},
+        telemetry{}
+        {};
+};
+
+void printUsage(const char* program)
+{
+    std::cout << "usage: " << program << " [options]\n"
+              << "  --offscreen <dir>        render headless, write frames into <dir>\n"
+              << "  --format png|y4m         frame encoding (default png)\n"
+              << "  --context native|egl|osmesa\n"
+              << "                           GL context backend for offscreen runs\n"
+              << "  --frames <n>             stop after n captured frames\n"
+              << "  --fps <n>                playback rate for y4m output (default 30)\n"
+              << "  --frame-interval <t>     simulation time between captured frames\n"
+              << "  --dt <t>                 fixed simulation step for offscreen runs\n"
+              << "  --size <w>x<h>           framebuffer size\n"
+              << "  --workers <n>            split the force loop over n worker processes (Linux)\n"
+              << "  --theta <t>              approximate distant domains once size/distance < t (default 0.5, 0 = exact)\n"
+              << "  --diagnostics <n>        print energy drift every n frames\n"
+              << "  --checkpoint <file>      write body state to file periodically\n"
+              << "  --checkpoint-every <n>   frames between checkpoints (default 600)\n"
+              << "  --graph-dump <n>         print frame stage timings every n frames\n"
+              << "  --predict-horizon <t>    simulation time shown by orbit previews (0 = off)\n"
+              << "  --telemetry <socket>     publish prometheus metrics on a unix socket" << std::endl;
+}
+
+// returns false if the arguments could not be parsed
+bool parseOptions(int argc, char** argv, RunOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        // every option takes exactly one value
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--offscreen")
+        {
+            options.offscreen = true;
+            options.outputDir = value;
+        }
+        else if (arg == "--format")
+            options.format = value;
+        else if (arg == "--context")
+            options.context = value;
+        else if (arg == "--frames")
+            options.frames = std::atoi(value.c_str());
+        else if (arg == "--fps")
+            options.fps = std::atoi(value.c_str());
+        else if (arg == "--frame-interval")
+            options.frameInterval = std::strtof(value.c_str(), nullptr);
+        else if (arg == "--dt")
+            options.timeStep = std::strtof(value.c_str(), nullptr);
+        else if (arg == "--workers")
+            options.workers = std::atoi(value.c_str());
+        else if (arg == "--theta")
+            options.theta = std::strtof(value.c_str(), nullptr);
+        else if (arg == "--diagnostics")
+            options.diagnostics = std::atoi(value.c_str());
+        else if (arg == "--checkpoint")
+            options.checkpoint = value;
+        else if (arg == "--checkpoint-every")
+            options.checkpointEvery = std::atoi(value.c_str());
+        else if (arg == "--graph-dump")
+            options.graphDump = std::atoi(value.c_str());
+        else if (arg == "--predict-horizon")
+            options.predictHorizon = std::strtof(value.c_str(), nullptr);
+        else if (arg == "--telemetry")
+            options.telemetry = value;
+        else if (arg == "--size")
+        {
+            size_t x = value.find('x');
+            if (x == std::string::npos)
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            SCREEN_WIDTH = std::atoi(value.substr(0, x).c_str());
+            SCREEN_HEIGHT = std::atoi(value.substr(x + 1).c_str());
+            aspectRatio = static_cast<float>(SCREEN_WIDTH) / static_cast<float>(SCREEN_HEIGHT);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options.format != "png" && options.format != "y4m")
+    {
+        std::cerr << "Unknown frame format " << options.format << std::endl;
+        return false;
+    }
+    if (options.context != "native" && options.context != "egl" && options.context != "osmesa")
+    {
+        std::cerr << "Unknown context backend " << options.context << std::endl;
+        return false;
+    }
+    if (options.workers < 0 || options.theta < 0.0f || options.diagnostics < 0 || options.graphDump < 0
+        || options.predictHorizon < 0.0f)
+    {
+        std::cerr << "Workers, theta, diagnostics, graph dump and predict horizon must not be negative" << std::endl;
+        return false;
+    }
+    if (options.checkpointEvery <= 0)
+    {
+        std::cerr << "Checkpoint interval must be positive" << std::endl;
+        return false;
+    }
+    if (options.timeStep <= 0.0f || options.frameInterval <= 0.0f || options.fps <= 0
+        || SCREEN_WIDTH <= 0 || SCREEN_HEIGHT <= 0)
+    {
+        std::cerr << "Time step, frame interval, fps and size must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,269 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "constants.h"
+#include "structs.h"
+#include "body.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// orbit previews. a low priority thread integrates a copy of the system ahead of
+// the simulation and keeps the predicted paths of a few selected bodies as
+// polylines. the cache is only extended at its end and trimmed at its start as
+// time passes; it is thrown away and rebuilt only when the real bodies drift
+// away from it or invalidate() reports an edit. the preview uses a plain
+// softened leapfrog with a coarse step, so it is cheap but not exact.
+
+struct PredictedPaths
+{
+    std::vector<float> times;               // simulation time of each sample
+    std::vector<std::vector<float>> lines;  // xyz per sample, one line per selected body
+    long long generation;                   // bumps on every publish
+};
+
+class TrajectoryPredictor
+{
+private:
+    struct BodyState
+    {
+        Vector3 position, velocity;
+        float mass;
+    };
+
+    std::vector<int> selected;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    // written by the main thread under the lock
+    bool resetRequested;
+    std::vector<BodyState> requestState;
+    float requestTime;
+    float observedTime;
+    bool awaitingPublish; // a reset has been asked for and its first paths aren't out yet
+
+    std::shared_ptr<const PredictedPaths> published;
+    long long generation;
+
+    static std::vector<BodyState> cloneState(const std::vector<Body>& planets)
+    {
+        std::vector<BodyState> state(planets.size());
+        for (int i = 0; i < planets.size(); i++)
+            state[i] = BodyState{planets[i].position, planets[i].velocity, planets[i].mass};
+        return state;
+    }
+
+    void accelerations(const std::vector<BodyState>& state, std::vector<Vector3>& out) const
+    {
+        out.assign(state.size(), Vector3(0.0f, 0.0f, 0.0f));
+        for (int i = 0; i < state.size(); i++)
+        {
+            for (int j = i + 1; j < state.size(); j++)
+            {
+                Vector3 d(state[j].position - state[i].position);
+                float r2 = d.x * d.x + d.y * d.y + d.z * d.z + previewSoftening * previewSoftening;
+                float inverse = gravityConstant / (r2 * sqrtf(r2));
+                out[i] += d * (inverse * state[j].mass);
+                out[j] += d * (-inverse * state[i].mass);
+            }
+        }
+    }
+
+    void run()
+    {
+#ifdef __linux__
+        // lowest priority for this thread only, the simulation keeps the cpu it needs
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+        std::vector<BodyState> state;
+        std::vector<Vector3> acceleration;
+        float time = 0.0f;
+        int stepsSinceSample = 0;
+        PredictedPaths paths{{}, std::vector<std::vector<float>>(selected.size()), 0};
+
+        while (true)
+        {
+            float now;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // sleep until there is something to do; the timeout picks up the
+                // simulation moving on so the horizon can be extended
+                wake.wait_for(lock, std::chrono::milliseconds(20), [&] {
+                    return stopping || resetRequested || (!state.empty() && time < observedTime + horizon);
+                });
+                if (stopping) return;
+                if (resetRequested)
+                {
+                    state = std::move(requestState);
+                    time = requestTime;
+                    resetRequested = false;
+                    paths.times.clear();
+                    for (std::vector<float>& line : paths.lines) line.clear();
+                    stepsSinceSample = sampleEvery; // sample the starting point
+                    accelerations(state, acceleration);
+                }
+                now = observedTime;
+            }
+            if (state.empty() || time >= now + horizon) continue;
+
+            // drop the part of the path that is already in the past, keeping one
+            // sample before now so the line starts at the body
+            int past = 0;
+            while (past + 1 < paths.times.size() && paths.times[past + 1] <= now) past++;
+            if (past > 0)
+            {
+                paths.times.erase(paths.times.begin(), paths.times.begin() + past);
+                for (std::vector<float>& line : paths.lines) line.erase(line.begin(), line.begin() + past * 3);
+            }
+
+            // extend the tail a chunk at a time so resets are picked up quickly
+            for (int n = 0; n < chunkSteps && time < now + horizon; n++)
+            {
+                if (stepsSinceSample >= sampleEvery)
+                {
+                    paths.times.push_back(time);
+                    for (int k = 0; k < selected.size(); k++)
+                    {
+                        const Vector3& p = state[selected[k]].position;
+                        paths.lines[k].insert(paths.lines[k].end(), {p.x, p.y, p.z});
+                    }
+                    stepsSinceSample = 0;
+                }
+
+                // kick drift kick
+                for (int i = 0; i < state.size(); i++)
+                {
+                    state[i].velocity += acceleration[i] * (0.5f * previewStep);
+                    state[i].position += state[i].velocity * previewStep;
+                }
+                accelerations(state, acceleration);
+                for (int i = 0; i < state.size(); i++)
+                    state[i].velocity += acceleration[i] * (0.5f * previewStep);
+
+                time += previewStep;
+                stepsSinceSample++;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (resetRequested) continue; // stale, don't publish
+            paths.generation = ++generation;
+            published = std::make_shared<const PredictedPaths>(paths);
+            awaitingPublish = false;
+        }
+    }
+
+    // linear interpolation along a published line, false if time is outside it
+    static bool sample(const PredictedPaths& paths, int line, float time, Vector3& out)
+    {
+        const std::vector<float>& times = paths.times;
+        if (times.size() < 2 || time < times.front() || time > times.back()) return false;
+        int k = static_cast<int>(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+        k = std::min(std::max(k, 1), static_cast<int>(times.size()) - 1);
+        float t = (time - times[k - 1]) / std::max(times[k] - times[k - 1], 1e-9f);
+        const float* a = &paths.lines[line][(k - 1) * 3];
+        const float* b = &paths.lines[line][k * 3];
+        out = Vector3(a[0] + (b[0] - a[0]) * t, a[1] + (b[1] - a[1]) * t, a[2] + (b[2] - a[2]) * t);
+        return true;
+    }
+
+public:
+    float horizon;          // how far ahead to predict, in simulation time
+    float previewStep;      // leapfrog step of the preview integrator
+    float previewSoftening; // keeps close passes in the preview from blowing up
+    float tolerance;        // distance from the prediction that forces a rebuild
+    int sampleEvery;        // preview steps between polyline points
+    int chunkSteps;         // preview steps between publishes
+
+    TrajectoryPredictor(const std::vector<int>& selected, float horizon) :
+        selected{selected},
+        stopping{false},
+        resetRequested{false},
+        requestTime{0.0f},
+        observedTime{0.0f},
+        awaitingPublish{false},
+        generation{0},
+        horizon{horizon},
+        previewStep{0.02f},
+        previewSoftening{0.05f},
+        tolerance{0.05f},
+        sampleEvery{4},
+        chunkSteps{256}
+    {
+        worker = std::thread(&TrajectoryPredictor::run, this);
+    }
+
+    ~TrajectoryPredictor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    const std::vector<int>& selection() const { return selected; }
+
+    // throw the cache away and predict again from the current state (user edits)
+    void invalidate(const std::vector<Body>& planets, float simTime)
+    {
+        std::vector<BodyState> state = cloneState(planets);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requestState = std::move(state);
+            requestTime = simTime;
+            resetRequested = true;
+            awaitingPublish = true;
+            observedTime = simTime;
+        }
+        wake.notify_one();
+    }
+
+    // called once per step: moves the cache window along and checks the real
+    // bodies still follow it. only copies the system when a rebuild is needed
+    void observe(const std::vector<Body>& planets, float simTime)
+    {
+        std::shared_ptr<const PredictedPaths> paths = latest();
+        bool diverged = !paths;
+        for (int k = 0; paths && k < selected.size() && !diverged; k++)
+        {
+            Vector3 predicted;
+            if (!sample(*paths, k, simTime, predicted))
+            {
+                diverged = paths->times.empty() || simTime > paths->times.back();
+                continue;
+            }
+            Vector3 d(planets[selected[k]].position - predicted);
+            diverged = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) > tolerance;
+        }
+
+        bool pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            observedTime = simTime;
+            pending = awaitingPublish;
+        }
+        if (diverged && !pending) invalidate(planets, simTime);
+    }
+
+    // newest published paths, or null before the first one
+    std::shared_ptr<const PredictedPaths> latest()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return published;
+    }
+};
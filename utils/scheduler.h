@@ -0,0 +1,345 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <functional>
+#include <coroutine>
+#include <exception>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// a small task graph for one frame. each stage is a coroutine that the graph
+// starts on its executor once every dependency has finished: main thread stages
+// (anything touching GLFW or GL) run inside run() on the calling thread, worker
+// stages on a thread pool.
+// every node records when it started and finished so a run can be dumped with
+// its critical path.
+
+enum class Executor { Main, Worker };
+
+class TaskGraph;
+
+struct StageTask
+{
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    // stamps the stage's start when an executor first resumes it, so time
+    // spent waiting in a queue doesn't count as running
+    struct StartAwaiter
+    {
+        promise_type* promise;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(Handle) noexcept {}
+        void await_resume() noexcept;
+    };
+
+    // tells the graph the stage is done, then frees the coroutine frame
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        void await_suspend(Handle handle) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        TaskGraph* graph = nullptr;
+        int node = -1;
+
+        StageTask get_return_object() { return StageTask{Handle::from_promise(*this)}; }
+        StartAwaiter initial_suspend() noexcept { return StartAwaiter{this}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Handle handle;
+};
+
+class TaskGraph
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Node
+    {
+        std::string name;
+        Executor executor;
+        std::vector<int> dependencies;
+        std::vector<int> dependents;
+        std::function<StageTask()> body;
+        int waitingOn;
+        double start, end; // milliseconds since the run began
+    };
+
+    std::vector<Node> nodes;
+    Clock::time_point runStart;
+    int remaining;
+
+    std::mutex mutex;
+    std::condition_variable mainWake;
+    std::condition_variable workerWake;
+    std::deque<std::coroutine_handle<>> mainQueue;
+    std::deque<std::coroutine_handle<>> workerQueue;
+    std::vector<std::thread> workers;
+    bool stopping;
+
+    double elapsed() const
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - runStart).count();
+    }
+
+    // caller holds the lock
+    void enqueue(Executor executor, std::coroutine_handle<> handle)
+    {
+        if (executor == Executor::Main)
+        {
+            mainQueue.push_back(handle);
+            mainWake.notify_one();
+        }
+        else
+        {
+            workerQueue.push_back(handle);
+            workerWake.notify_one();
+        }
+    }
+
+    // caller holds the lock
+    void launch(int index)
+    {
+        Node& node = nodes[index];
+        StageTask task = node.body();
+        task.handle.promise().graph = this;
+        task.handle.promise().node = index;
+        enqueue(node.executor, task.handle);
+    }
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workerWake.wait(lock, [this] { return stopping || !workerQueue.empty(); });
+                if (stopping) return;
+                handle = workerQueue.front();
+                workerQueue.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+public:
+    explicit TaskGraph(int workerCount = 0) :
+        remaining{0},
+        stopping{false}
+    {
+        if (workerCount <= 0)
+            workerCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+        for (int i = 0; i < workerCount; i++)
+            workers.emplace_back(&TaskGraph::workerLoop, this);
+    }
+
+    ~TaskGraph()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workerWake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    // dependencies must already have been added, returns the new node's id
+    int add(const std::string& name, Executor executor, std::vector<int> dependencies, std::function<StageTask()> body)
+    {
+        nodes.push_back(Node{name, executor, dependencies, {}, body, 0, 0.0, 0.0});
+        int index = static_cast<int>(nodes.size()) - 1;
+        for (int dependency : dependencies) nodes[dependency].dependents.push_back(index);
+        return index;
+    }
+
+    // timings of the last run, for exporting
+    int stageCount() const { return static_cast<int>(nodes.size()); }
+    const std::string& stageName(int index) const { return nodes[index].name; }
+    double stageMilliseconds(int index) const { return nodes[index].end - nodes[index].start; }
+    double runMilliseconds() const
+    {
+        double latest = 0.0;
+        for (const Node& node : nodes) latest = std::max(latest, node.end);
+        return latest;
+    }
+
+    // called on the executor when a stage's coroutine first runs. only that
+    // thread touches the node until complete() takes the lock
+    void started(int index)
+    {
+        nodes[index].start = elapsed();
+    }
+
+    // called when a stage's coroutine reaches its end
+    void complete(int index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nodes[index].end = elapsed();
+        for (int dependent : nodes[index].dependents)
+        {
+            if (--nodes[dependent].waitingOn == 0) launch(dependent);
+        }
+        if (--remaining == 0) mainWake.notify_one();
+    }
+
+    // runs every stage once, main thread stages execute here on the caller
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        runStart = Clock::now();
+        remaining = static_cast<int>(nodes.size());
+        for (Node& node : nodes) node.waitingOn = static_cast<int>(node.dependencies.size());
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].waitingOn == 0) launch(i);
+        }
+
+        while (remaining > 0)
+        {
+            mainWake.wait(lock, [this] { return remaining == 0 || !mainQueue.empty(); });
+            while (!mainQueue.empty())
+            {
+                std::coroutine_handle<> handle = mainQueue.front();
+                mainQueue.pop_front();
+                lock.unlock();
+                handle.resume();
+                lock.lock();
+            }
+        }
+    }
+
+    // per stage timings of the last run, then the chain of stages that set its length
+    void dump(std::ostream& stream)
+    {
+        double total = 0.0;
+        int last = -1;
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            if (last < 0 || nodes[i].end > nodes[last].end) last = i;
+        }
+        if (last >= 0) total = nodes[last].end;
+
+        stream << std::fixed << std::setprecision(3);
+        stream << "stage                 executor   start(ms)   end(ms)   took(ms)" << std::endl;
+        for (const Node& node : nodes)
+        {
+            stream << std::left << std::setw(22) << node.name
+                   << std::setw(9) << (node.executor == Executor::Main ? "main" : "worker")
+                   << std::right << std::setw(10) << node.start
+                   << std::setw(10) << node.end
+                   << std::setw(11) << node.end - node.start << std::endl;
+        }
+
+        // walk back from the last stage to finish through whichever dependency released it
+        std::vector<int> path;
+        for (int i = last; i >= 0; )
+        {
+            path.push_back(i);
+            int latest = -1;
+            for (int dependency : nodes[i].dependencies)
+            {
+                if (latest < 0 || nodes[dependency].end > nodes[latest].end) latest = dependency;
+            }
+            i = latest;
+        }
+
+        stream << "critical path (" << total << " ms): ";
+        for (int k = static_cast<int>(path.size()) - 1; k >= 0; k--)
+        {
+            const Node& node = nodes[path[k]];
+            stream << node.name << " " << node.end - node.start << "ms" << (k > 0 ? " -> " : "");
+        }
+        stream << std::defaultfloat << std::endl;
+    }
+};
+
+// runs jobs one at a time on its own thread, outside of any frame. for slow
+// work nothing in the frame depends on (disk writes, full energy sweeps), so a
+// frame never waits for it; a job must carry copies of whatever it reads
+class BackgroundQueue
+{
+private:
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    size_t maxJobs;
+    bool stopping;
+
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return; // stopping and drained
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit BackgroundQueue(size_t maxJobs = 4) :
+        maxJobs{maxJobs},
+        stopping{false}
+    {
+        worker = std::thread(&BackgroundQueue::run, this);
+    }
+
+    ~BackgroundQueue() { finish(); }
+
+    // false (and the job is dropped) while maxJobs are still waiting
+    bool post(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || jobs.size() >= maxJobs) return false;
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    // runs whatever is queued, then stops the thread
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+void StageTask::StartAwaiter::await_resume() noexcept
+{
+    promise->graph->started(promise->node);
+}
+
+void StageTask::FinalAwaiter::await_suspend(Handle handle) noexcept
+{
+    TaskGraph* graph = handle.promise().graph;
+    int node = handle.promise().node;
+    handle.destroy();
+    graph->complete(node);
+}
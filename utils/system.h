@@ -1,43 +1,159 @@
+#pragma once
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
 #include <vector>
 
 #include "constants.h"
 #include "structs.h"
 #include "body.h"
+#include "forces.h"
+#include "domain.h"
+#include "encounter.h"
 
 
+// body state at one step, detached from the live system
+struct SystemSnapshot
+{
+    double time;
+    int pairs;
+    std::vector<float> mass;
+    std::vector<Vector3> position, velocity;
+    std::vector<int> partner; // as EncounterManager::partner
+    std::vector<Vector3> center; // as EncounterManager::centers
+    float nearRadius;            // the encounter radius
+
+    // one line per body (mass, position, velocity), written next to the target and
+    // renamed over it so a crash mid-write never leaves a torn checkpoint
+    bool saveCheckpoint(const std::string& path) const
+    {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary);
+            if (!file) return false;
+            file.precision(9);
+            file << "# time " << time << " bodies " << mass.size() << "\n";
+            for (int i = 0; i < mass.size(); i++)
+            {
+                file << mass[i] << ' '
+                     << position[i].x << ' ' << position[i].y << ' ' << position[i].z << ' '
+                     << velocity[i].x << ' ' << velocity[i].y << ' ' << velocity[i].z << '\n';
+            }
+            if (!file) return false;
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // kinetic plus potential energy, for drift diagnostics
+    double totalEnergy() const
+    {
+        double energy = 0.0;
+        for (int i = 0; i < mass.size(); i++)
+        {
+            const Vector3& v = velocity[i];
+            energy += 0.5 * mass[i] * (v.x * v.x + v.y * v.y + v.z * v.z);
+            for (int j = i + 1; j < mass.size(); j++)
+            {
+                // the pair's own members are exact, everything else as the force loop sees it
+                Vector3 from(position[i]), to(position[j]);
+                float softening = 0.0f;
+                if (partner[i] != j)
+                {
+                    interactionPoints(position[i], center[i], partner[i] >= 0, position[j], center[j], partner[j] >= 0,
+                                      nearRadius, from, to, softening);
+                }
+                Vector3 d(to - from);
+                double r = sqrt(static_cast<double>(d.x) * d.x + static_cast<double>(d.y) * d.y + static_cast<double>(d.z) * d.z
+                                + static_cast<double>(softening) * softening);
+                if (r > 0.0) energy -= gravityConstant * static_cast<double>(mass[i]) * mass[j] / r;
+            }
+        }
+        return energy;
+    }
+};
+
 struct System
 {
     std::vector<Body*> planets;
+    DomainDecomposition* domains; // optional, spreads the force loop over worker processes
+    EncounterManager encounters;  // close pairs, advanced in KS coordinates
+    std::vector<Vector3> centers; // per body, where the force loop sees it from afar
+    int64_t interactions;         // force evaluations in the last computeSystemProperties()
 
     System(std::vector<Body*> bodies)
-        : planets{bodies}
+        : planets{bodies},
+          domains{nullptr},
+          interactions{0}
     {}
 
+    // external accelerations only: a regularized pair's mutual pull is left to the pair
     void computeSystemProperties()
     {
+        if (encounters.partner.size() != planets.size()) encounters.partner.assign(planets.size(), -1);
+        const std::vector<int>& partner = encounters.partner;
+        encounters.centers(planets, centers);
+        float nearRadius = encounters.encounterRadius;
+
+        if (domains && domains->computeAccelerations(planets, partner, centers, nearRadius))
+        {
+            interactions = domains->interactions();
+            return;
+        }
+
+        interactions = 0;
         for (int i = 0; i < planets.size(); i++)
         {
             Vector3 totalAcceleration(0.0f, 0.0f, 0.0f);
             for (int j = 0; j < planets.size(); j++)
             {
-                if (i==j) continue;
+                if (i==j || j==partner[i]) continue;
 
-                Vector3 distance(planets[j]->position - planets[i]->position);
+                totalAcceleration += interactionAcceleration(planets[i]->position, centers[i], partner[i] >= 0,
+                                                             planets[j]->position, centers[j], partner[j] >= 0,
+                                                             planets[j]->mass, nearRadius);
+                interactions++;
+            }
+            planets[i]->acceleration = totalAcceleration;
+        }
+    }
 
-                distance.scalarMultiply(2.389e-10f);
-                
-                float r = sqrtf(pow(distance.x, 2) + pow(distance.y, 2) + pow(distance.z, 2) + 0.01f);
-                
-                // gravitational acceleration magnitude (mass of i reduces to 1)
-                float a = (gravityConstant * planets[j]->mass) / pow(r, 2);
+    // first half of a step: pair up close bodies, then the force loop
+    void computeForces()
+    {
+        encounters.detect(planets);
+        computeSystemProperties();
+    }
 
-                Vector3 unitVector(distance.x/r, distance.y/r, distance.z/r);
-                
-                totalAcceleration += unitVector*a;
+    // second half of a step: move everything with the accelerations from computeForces()
+    void integrate(float deltaTime)
+    {
+        for (int i = 0; i < planets.size(); i++)
+        {
+            if (encounters.partner[i] >= 0) continue;
+            planets[i]->accelerate(deltaTime);
+            planets[i]->updatePosition(deltaTime);
+        }
+        encounters.advance(planets, deltaTime);
+    }
 
-            }
-            planets[i]->acceleration = totalAcceleration;
+    // copies what checkpoints and diagnostics read, so they can run while the
+    // next step moves the bodies
+    SystemSnapshot snapshot(double time) const
+    {
+        SystemSnapshot state;
+        state.time = time;
+        state.pairs = static_cast<int>(encounters.pairs.size());
+        for (const Body* planet : planets)
+        {
+            state.mass.push_back(planet->mass);
+            state.position.push_back(planet->position);
+            state.velocity.push_back(planet->velocity);
         }
+        state.partner = encounters.partner;
+        if (state.partner.size() != planets.size()) state.partner.assign(planets.size(), -1);
+        encounters.centers(planets, state.center);
+        state.nearRadius = encounters.encounterRadius;
+        return state;
     }
 };
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// live telemetry. simulation code updates metrics with relaxed atomic stores,
+// never a lock, and a publisher thread serves a snapshot in the prometheus text
+// format to whoever connects to a unix domain socket:
+//   curl --unix-socket /tmp/gravity.sock http://localhost/metrics
+//   socat - UNIX-CONNECT:/tmp/gravity.sock
+// rates (steps/s, interactions/s) are derived by the publisher from the counters
+// between two scrapes, so the simulation only ever bumps counters.
+
+class Metric
+{
+private:
+    std::atomic<double> value;
+
+public:
+    std::string name;
+    std::string labels; // already formatted, e.g. phase="force"
+    std::string help;
+    std::string type;   // "counter" or "gauge"
+
+    Metric(const std::string& name, const std::string& labels, const std::string& help, const std::string& type) :
+        value{0.0},
+        name{name},
+        labels{labels},
+        help{help},
+        type{type}
+        {};
+
+    void set(double v) { value.store(v, std::memory_order_relaxed); }
+    void add(double v) { value.fetch_add(v, std::memory_order_relaxed); }
+    double get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// metrics are registered up front, before start(); a deque keeps their
+// addresses stable so callers can hold on to the pointers
+class Telemetry
+{
+private:
+    std::deque<Metric> metrics;
+    std::string socketPath;
+    int listener;
+    std::thread publisher;
+    std::atomic<bool> stopping;
+
+    // derived on the publisher thread
+    Metric* steps;
+    Metric* interactions;
+    Metric* stepRate;
+    Metric* interactionRate;
+    Metric* residentBytes;
+    double lastSteps, lastInteractions;
+    std::chrono::steady_clock::time_point lastScrape;
+
+    void refreshDerived()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastScrape).count();
+        if (seconds > 0.0)
+        {
+            double stepCount = steps->get(), interactionCount = interactions->get();
+            stepRate->set((stepCount - lastSteps) / seconds);
+            interactionRate->set((interactionCount - lastInteractions) / seconds);
+            lastSteps = stepCount;
+            lastInteractions = interactionCount;
+            lastScrape = now;
+        }
+
+#ifdef __linux__
+        // second field of statm is the resident set in pages
+        std::ifstream statm("/proc/self/statm");
+        long pages = 0, resident = 0;
+        if (statm >> pages >> resident)
+            residentBytes->set(static_cast<double>(resident) * sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    std::string render()
+    {
+        refreshDerived();
+
+        std::ostringstream out;
+        out.precision(12);
+        const std::string* previous = nullptr;
+        for (const Metric& metric : metrics)
+        {
+            // HELP and TYPE once per family, labeled series follow each other
+            if (!previous || *previous != metric.name)
+            {
+                out << "# HELP " << metric.name << ' ' << metric.help << '\n';
+                out << "# TYPE " << metric.name << ' ' << metric.type << '\n';
+            }
+            previous = &metric.name;
+            out << metric.name;
+            if (!metric.labels.empty()) out << '{' << metric.labels << '}';
+            out << ' ' << metric.get() << '\n';
+        }
+        return out.str();
+    }
+
+    static void sendAll(int fd, const std::string& data)
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL; // a scraper hanging up must not kill the simulation
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, flags);
+            if (n <= 0) return;
+            sent += n;
+        }
+    }
+
+    void serve(int client)
+    {
+        // curl sends an http request, plain socket readers send nothing
+        char request[512];
+        pollfd readable{client, POLLIN, 0};
+        bool http = false;
+        if (poll(&readable, 1, 50) > 0)
+        {
+            ssize_t n = recv(client, request, sizeof(request), 0);
+            http = n >= 3 && std::strncmp(request, "GET", 3) == 0;
+        }
+
+        std::string body = render();
+        if (http)
+        {
+            sendAll(client, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                            + std::to_string(body.size()) + "\r\n\r\n");
+        }
+        sendAll(client, body);
+        close(client);
+    }
+
+    void run()
+    {
+        while (!stopping.load())
+        {
+            pollfd waiting{listener, POLLIN, 0};
+            if (poll(&waiting, 1, 200) <= 0) continue;
+            int client = accept(listener, NULL, NULL);
+            if (client >= 0) serve(client);
+        }
+    }
+
+public:
+    Telemetry() :
+        listener{-1},
+        stopping{false},
+        lastSteps{0.0},
+        lastInteractions{0.0},
+        lastScrape{std::chrono::steady_clock::now()}
+    {
+        steps = add("gravity_steps_total", "", "Simulation steps taken.", "counter");
+        interactions = add("gravity_interactions_total", "", "Force evaluations, a distant domain taken as one point mass counts once.", "counter");
+        stepRate = add("gravity_step_rate", "", "Steps per second since the previous scrape.", "gauge");
+        interactionRate = add("gravity_interactions_per_second", "", "Force evaluations per second since the previous scrape.", "gauge");
+        residentBytes = add("gravity_resident_memory_bytes", "", "Resident set size of the process.", "gauge");
+    }
+
+    ~Telemetry() { stop(); }
+
+    Metric* add(const std::string& name, const std::string& labels, const std::string& help, const std::string& type)
+    {
+        metrics.emplace_back(name, labels, help, type);
+        return &metrics.back();
+    }
+
+    Metric* stepCounter() { return steps; }
+    Metric* interactionCounter() { return interactions; }
+
+    // binds the socket and starts publishing, no metrics may be added after this
+    bool start(const std::string& path)
+    {
+        socketPath = path;
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "Telemetry socket path is too long: " << path << std::endl;
+            return false;
+        }
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        // a socket left over from a previous run is replaced, anything else is not ours
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0)
+        {
+            if (!S_ISSOCK(existing.st_mode))
+            {
+                std::cerr << "Telemetry path " << path << " exists and is not a socket, not replacing it" << std::endl;
+                return false;
+            }
+            // only stale if nobody is listening on it any more
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool refused = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                           && errno == ECONNREFUSED;
+            if (probe >= 0) close(probe);
+            if (!refused)
+            {
+                std::cerr << "Telemetry socket " << path << " is in use or unreachable, not replacing it" << std::endl;
+                return false;
+            }
+            unlink(path.c_str());
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, 4) != 0)
+        {
+            std::cerr << "Failed to open telemetry socket " << path << ": " << std::strerror(errno) << std::endl;
+            if (listener >= 0) close(listener);
+            listener = -1;
+            return false;
+        }
+
+        publisher = std::thread(&Telemetry::run, this);
+        std::cout << "Publishing telemetry on " << path << std::endl;
+        return true;
+    }
+
+    void stop()
+    {
+        stopping.store(true);
+        if (publisher.joinable()) publisher.join();
+        if (listener >= 0)
+        {
+            close(listener);
+            unlink(socketPath.c_str());
+            listener = -1;
+        }
+    }
+};